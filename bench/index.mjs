@@ -0,0 +1,131 @@
+import fs from "fs/promises";
+import os from "os";
+import path from "path";
+import { spawn } from "child_process";
+import { once } from "events";
+import { fileURLToPath } from "url";
+import createMockServer from "./mockServer.mjs";
+
+const MB = 1024 * 1024;
+const benchPath = path.dirname(fileURLToPath(import.meta.url));
+const downloaderPath = path.join(
+    benchPath,
+    "../dist/mltd-asset-downloader.js"
+);
+
+const scenarios = {
+    "small-files": {
+        assets: 10000,
+        minSize: 1024,
+        maxSize: 16384,
+        latency: 10
+    },
+    "large-files": {
+        assets: 16,
+        minSize: 40 * MB,
+        maxSize: 64 * MB,
+        latency: 30,
+        bandwidth: 200 * MB
+    },
+    lossy: {
+        assets: 2000,
+        minSize: 4096,
+        maxSize: 262144,
+        latency: 40,
+        errorRate: 0.02,
+        resetRate: 0.01
+    },
+    "huge-manifest": {
+        assets: 200000,
+        minSize: 64,
+        maxSize: 512
+    }
+};
+
+const percentile = (sorted, p) =>
+    sorted.length === 0
+        ? 0
+        : sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+
+// downloads every asset of the scenario into a fresh directory and
+// measures the run from the server side
+const run = async (name, options, downloaderArgs) => {
+    const mock = createMockServer(options);
+    const url = await mock.listen();
+    const outputPath = await fs.mkdtemp(path.join(os.tmpdir(), "mltd-bench-"));
+    const rssFile = path.join(outputPath, "rss");
+
+    const start = process.hrtime.bigint();
+    const child = spawn(
+        process.execPath,
+        [
+            "--require",
+            path.join(benchPath, "peakRss.cjs"),
+            downloaderPath,
+            "-L",
+            "zh",
+            "-o",
+            path.join(outputPath, "assets"),
+            "--api-url",
+            url,
+            "--data-url",
+            url,
+            ...downloaderArgs
+        ],
+        {
+            env: { ...process.env, BENCH_RSS_FILE: rssFile },
+            stdio: ["ignore", "ignore", "pipe"]
+        }
+    );
+    let stderr = "";
+    child.stderr.on("data", data => (stderr += data));
+    const [code] = await once(child, "exit");
+    const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+
+    const latencies = mock.stats.latencies.sort((a, b) => a - b);
+    const result = {
+        scenario: name,
+        files: options.assets,
+        "MB/s": +(mock.totalSize / MB / seconds).toFixed(1),
+        "req/s": Math.round(mock.stats.requests / seconds),
+        "p50 ms": percentile(latencies, 0.5),
+        "p99 ms": percentile(latencies, 0.99),
+        "peak RSS MB": Math.round(
+            parseInt(await fs.readFile(rssFile, "utf8"), 10) / MB
+        ),
+        seconds: +seconds.toFixed(1)
+    };
+    const files = await fs
+        .readdir(path.join(outputPath, "assets", "80000"))
+        .catch(() => []);
+    await mock.close();
+    await fs.rm(outputPath, { recursive: true, force: true });
+    if (code !== 0) throw new Error(`${name} exited with ${code}\n${stderr}`);
+    if (files.length < options.assets)
+        throw new Error(
+            `${name} saved ${files.length} of ${options.assets} files`
+        );
+    return result;
+};
+
+// node bench/index.mjs [scenario ...] [-- downloader options]
+const argv = process.argv.slice(2);
+const separator = argv.indexOf("--");
+const names = separator < 0 ? argv : argv.slice(0, separator);
+const downloaderArgs = separator < 0 ? [] : argv.slice(separator + 1);
+for (const name of names)
+    if (!(name in scenarios)) {
+        console.error(
+            `unknown scenario ${name}, choose from ${Object.keys(
+                scenarios
+            ).join(", ")}`
+        );
+        process.exit(1);
+    }
+
+const results = [];
+for (const name of names.length > 0 ? names : Object.keys(scenarios)) {
+    console.error(`running ${name} ...`);
+    results.push(await run(name, scenarios[name], downloaderArgs));
+}
+console.table(results);
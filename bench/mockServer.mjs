@@ -0,0 +1,234 @@
+import crypto from "crypto";
+import http from "http";
+import { once } from "events";
+import { pathToFileURL } from "url";
+import { encode } from "@msgpack/msgpack";
+
+const blockSize = 1 << 16;
+const chunkSize = 1 << 14;
+const version = 80000;
+const indexName = "benchmark.data";
+
+const sleep = ms => new Promise(resolve => setTimeout(resolve, ms));
+
+// small deterministic generator (mulberry32) so every run serves the same
+// files
+const random = seed => () => {
+    seed = (seed + 0x6d2b79f5) | 0;
+    let t = Math.imul(seed ^ (seed >>> 15), 1 | seed);
+    t = (t + Math.imul(t ^ (t >>> 7), 61 | t)) ^ t;
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+};
+
+// every asset repeats one random block from an offset of its own, so bodies
+// are produced on the fly instead of being kept in memory; the block is
+// stored twice to read any chunk without wrapping around
+const randomBlock = crypto.randomBytes(blockSize);
+const block = Buffer.concat([randomBlock, randomBlock]);
+const assetBody = function* (asset, start, end) {
+    let position = start;
+    while (position < end) {
+        const offset = (asset.offset + position) % blockSize;
+        const length = Math.min(chunkSize, end - position);
+        yield block.subarray(offset, offset + length);
+        position += length;
+    }
+};
+
+const createAssets = options => {
+    const next = random(options.seed);
+    const assets = [];
+    for (let i = 0; i < options.assets; i++) {
+        const size = Math.round(
+            options.minSize + next() * (options.maxSize - options.minSize)
+        );
+        const asset = {
+            name: `asset_${i}.unity3d`,
+            file: `${i.toString(16).padStart(8, "0")}.unity3d`,
+            offset: Math.floor(next() * blockSize),
+            size
+        };
+        const hash = crypto.createHash("md5");
+        for (const chunk of assetBody(asset, 0, size)) hash.update(chunk);
+        asset.md5 = hash.digest();
+        assets.push(asset);
+    }
+    return assets;
+};
+
+export const defaultOptions = {
+    assets: 1000,
+    minSize: 1024,
+    maxSize: 65536,
+    // milliseconds before the response headers of every request
+    latency: 0,
+    // bytes per second shared by all responses, 0 for unlimited
+    bandwidth: 0,
+    // fraction of asset requests answered with 503
+    errorRate: 0,
+    // fraction of asset responses cut off halfway through the body
+    resetRate: 0,
+    seed: 1
+};
+
+// mimics api.matsurihi.me and the asset CDN for a single version: the
+// version list, its msgpack manifest and asset bodies with x-goog-hash,
+// range and HEAD support
+const createMockServer = options => {
+    options = { ...defaultOptions, ...options };
+    const assets = createAssets(options);
+    const files = new Map(assets.map(asset => [asset.file, asset]));
+    const manifest = {};
+    for (const asset of assets)
+        manifest[asset.name] = [
+            asset.md5.toString("hex"),
+            asset.file,
+            asset.size
+        ];
+    const manifestBody = Buffer.from(encode([manifest]));
+    files.set(indexName, {
+        body: manifestBody,
+        size: manifestBody.length,
+        md5: crypto.createHash("md5").update(manifestBody).digest()
+    });
+    const versionInfo = {
+        version,
+        indexName,
+        updatedAt: new Date(0).toISOString()
+    };
+
+    const stats = {
+        requests: 0,
+        bytes: 0,
+        errors: 0,
+        resets: 0,
+        // milliseconds from request to the last byte of every asset response
+        latencies: []
+    };
+    let nextFree = 0;
+    const throttle = async bytes => {
+        if (options.bandwidth <= 0) return;
+        const now = Date.now();
+        nextFree =
+            Math.max(nextFree, now) + (bytes * 1000) / options.bandwidth;
+        if (nextFree > now) await sleep(nextFree - now);
+    };
+
+    const handle = async (req, res) => {
+        const received = Date.now();
+        stats.requests++;
+        if (options.latency > 0) await sleep(options.latency);
+
+        const api = req.url.match(/^\/mltd\/v1\/\w+\/version\/(\w+)$/);
+        if (api) {
+            res.setHeader("content-type", "application/json");
+            res.end(
+                JSON.stringify(
+                    api[1] === "latest" ? { res: versionInfo } : [versionInfo]
+                )
+            );
+            return;
+        }
+        const data = req.url.match(
+            /^\/(\d+)\/production\/\w+\/Android\/(.+)$/
+        );
+        const file = data && +data[1] === version && files.get(data[2]);
+        if (!file) {
+            res.statusCode = 404;
+            res.end();
+            return;
+        }
+        // only asset bodies fail, like the downloads this is measuring
+        const generated = file.body === undefined;
+        if (generated && Math.random() < options.errorRate) {
+            stats.errors++;
+            res.statusCode = 503;
+            res.end();
+            return;
+        }
+
+        let from = 0;
+        let to = file.size;
+        const range = (req.headers.range ?? "").match(/^bytes=(\d+)-(\d*)$/);
+        if (range) {
+            from = +range[1];
+            if (range[2] !== "") to = Math.min(to, +range[2] + 1);
+            if (from >= file.size) {
+                res.writeHead(416, {
+                    "content-range": `bytes */${file.size}`
+                });
+                res.end();
+                return;
+            }
+        }
+        const md5 = file.md5.toString("base64");
+        const headers = {
+            "content-length": to - from,
+            "accept-ranges": "bytes",
+            "x-goog-hash": `crc32c=AAAAAA==,md5=${md5}`
+        };
+        if (range)
+            headers["content-range"] = `bytes ${from}-${to - 1}/${file.size}`;
+        res.writeHead(range ? 206 : 200, headers);
+        if (req.method === "HEAD") {
+            res.end();
+            return;
+        }
+
+        const cut =
+            generated && Math.random() < options.resetRate
+                ? from + Math.floor((to - from) / 2)
+                : to;
+        const body = generated
+            ? assetBody(file, from, cut)
+            : [file.body.subarray(from, to)];
+        for (const chunk of body) {
+            await throttle(chunk.length);
+            stats.bytes += chunk.length;
+            if (!res.write(chunk)) await once(res, "drain");
+            if (res.destroyed) return;
+        }
+        if (cut < to) {
+            stats.resets++;
+            res.destroy();
+            return;
+        }
+        res.end();
+        if (generated) stats.latencies.push(Date.now() - received);
+    };
+
+    const server = http.createServer((req, res) =>
+        handle(req, res).catch(() => res.destroy())
+    );
+    server.keepAliveTimeout = 30000;
+    return {
+        server,
+        stats,
+        totalSize: assets.reduce((total, asset) => total + asset.size, 0),
+        listen: async port => {
+            server.listen(port ?? 0, "127.0.0.1");
+            await once(server, "listening");
+            return `http://127.0.0.1:${server.address().port}/`;
+        },
+        close: async () => {
+            server.closeAllConnections?.();
+            server.close();
+            await once(server, "close");
+        }
+    };
+};
+
+export default createMockServer;
+
+// node bench/mockServer.mjs [--port 8080] [--assets 10000] [--latency 20] ...
+if (import.meta.url === pathToFileURL(process.argv[1]).href) {
+    const options = {};
+    const argv = process.argv.slice(2);
+    for (let i = 0; i < argv.length; i += 2)
+        options[argv[i].replace(/^--/, "")] = parseFloat(argv[i + 1]);
+    const { port, ...serverOptions } = options;
+    const mock = createMockServer(serverOptions);
+    const url = await mock.listen(port);
+    console.log(`mock server listening on ${url}`);
+    console.log(`--api-url ${url} --data-url ${url}`);
+}
@@ -0,0 +1,9 @@
+// preloaded into the downloader by the benchmark to report its peak rss
+const fs = require("fs");
+
+process.on("exit", () =>
+    fs.writeFileSync(
+        process.env.BENCH_RSS_FILE,
+        `${process.resourceUsage().maxRSS * 1024}`
+    )
+);
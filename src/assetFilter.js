@@ -0,0 +1,55 @@
+import { sprintf } from "sprintf-js";
+
+const units = { "": 0, k: 1, m: 2, g: 3, t: 4 };
+
+const parseSize = (size, i18n) => {
+    const match = `${size}`.trim().match(/^(\d+(?:\.\d+)?)\s*([kmgt]?)i?b?$/i);
+    if (!match) throw new Error(sprintf(i18n.invalidSize, size));
+    return parseFloat(match[1]) * 1024 ** units[match[2].toLowerCase()];
+};
+
+const escape = str => str.replace(/[.*+?^${}()|[\]\\]/g, "\\$&");
+
+// /regex/flags, or a glob where * matches any run of characters and ? one
+const toRegExp = (pattern, i18n) => {
+    const regex = pattern.match(/^\/(.*)\/([a-z]*)$/);
+    try {
+        // g and y would make test() resume from the last match
+        if (regex) return new RegExp(regex[1], regex[2].replace(/[gy]/g, ""));
+    } catch (e) {
+        throw new Error(sprintf(i18n.invalidPattern, pattern));
+    }
+    return new RegExp(
+        `^${pattern
+            .split("*")
+            .map(part => part.split("?").map(escape).join("."))
+            .join(".*")}$`
+    );
+};
+
+// predicate over manifest entries for --include, --exclude, --min-size and
+// --max-size, or undefined when every asset is wanted
+const createAssetFilter = (args, i18n) => {
+    const include = args.include.map(pattern => toRegExp(pattern, i18n));
+    const exclude = args.exclude.map(pattern => toRegExp(pattern, i18n));
+    const minSize =
+        args.minSize !== undefined ? parseSize(args.minSize, i18n) : 0;
+    const maxSize =
+        args.maxSize !== undefined ? parseSize(args.maxSize, i18n) : Infinity;
+    if (
+        include.length === 0 &&
+        exclude.length === 0 &&
+        minSize === 0 &&
+        maxSize === Infinity
+    )
+        return undefined;
+
+    return asset =>
+        asset.size >= minSize &&
+        asset.size <= maxSize &&
+        (include.length === 0 ||
+            include.some(regex => regex.test(asset.name))) &&
+        !exclude.some(regex => regex.test(asset.name));
+};
+
+export default createAssetFilter;
@@ -0,0 +1,132 @@
+// names and file names are interned in one table shared by every index, so a
+// name that appears in hundreds of versions is stored only once
+const strings = [];
+const stringIds = new Map();
+
+const intern = str => {
+    let id = stringIds.get(str);
+    if (id === undefined) {
+        id = strings.length;
+        strings.push(str);
+        stringIds.set(str, id);
+    }
+    return id;
+};
+
+const isHex = str => typeof str === "string" && /^(?:[0-9a-f]{2})*$/.test(str);
+
+// struct-of-arrays list of the assets in a manifest; hex hashes are packed as
+// bytes, anything else falls back to interned strings
+class AssetIndex {
+    constructor(length, hashLength) {
+        this.length = length;
+        this.hashLength = hashLength;
+        this.names = new Uint32Array(length);
+        this.files = new Uint32Array(length);
+        this.sizes = new Float64Array(length);
+        this.hashes =
+            hashLength > 0
+                ? new Uint8Array(length * hashLength)
+                : new Uint32Array(length);
+    }
+
+    static fromManifest(manifest) {
+        const keys = Object.keys(manifest);
+        const hashLength =
+            keys.length > 0 ? manifest[keys[0]][0].length / 2 : 0;
+        const packed =
+            hashLength > 0 &&
+            keys.every(
+                key =>
+                    isHex(manifest[key][0]) &&
+                    manifest[key][0].length === hashLength * 2
+            );
+        const index = new AssetIndex(keys.length, packed ? hashLength : 0);
+        keys.forEach((key, i) => {
+            const [hash, file, size] = manifest[key];
+            index.names[i] = intern(key);
+            index.files[i] = intern(file);
+            index.sizes[i] = size;
+            if (packed)
+                index.hashes.set(Buffer.from(hash, "hex"), i * hashLength);
+            else index.hashes[i] = intern(`${hash}`);
+        });
+        return index;
+    }
+
+    hash(i) {
+        if (this.hashLength === 0) return strings[this.hashes[i]];
+        return Buffer.from(
+            this.hashes.buffer,
+            this.hashes.byteOffset + i * this.hashLength,
+            this.hashLength
+        ).toString("hex");
+    }
+
+    get(i) {
+        return {
+            name: strings[this.names[i]],
+            hash: this.hash(i),
+            file: strings[this.files[i]],
+            size: this.sizes[i]
+        };
+    }
+
+    *[Symbol.iterator]() {
+        for (let i = 0; i < this.length; i++) yield this.get(i);
+    }
+
+    // position of name in this index, or -1
+    indexOf(name) {
+        const id = stringIds.get(name);
+        if (id === undefined) return -1;
+        if (this.order === undefined)
+            this.order = Uint32Array.from(this.names.keys()).sort(
+                (a, b) => this.names[a] - this.names[b]
+            );
+        let low = 0;
+        let high = this.length - 1;
+        while (low <= high) {
+            const mid = (low + high) >>> 1;
+            const midId = this.names[this.order[mid]];
+            if (midId === id) return this.order[mid];
+            if (midId < id) low = mid + 1;
+            else high = mid - 1;
+        }
+        return -1;
+    }
+
+    find(name) {
+        const i = this.indexOf(name);
+        return i === -1 ? undefined : this.get(i);
+    }
+
+    totalSize() {
+        return this.sizes.reduce((size, assetSize) => size + assetSize, 0);
+    }
+
+    // copy of the rows for which predicate(asset, i) is true
+    filter(predicate) {
+        const selected = [];
+        for (let i = 0; i < this.length; i++)
+            if (predicate(this.get(i), i)) selected.push(i);
+        const index = new AssetIndex(selected.length, this.hashLength);
+        selected.forEach((from, to) => {
+            index.names[to] = this.names[from];
+            index.files[to] = this.files[from];
+            index.sizes[to] = this.sizes[from];
+            if (this.hashLength === 0) index.hashes[to] = this.hashes[from];
+            else
+                index.hashes.set(
+                    this.hashes.subarray(
+                        from * this.hashLength,
+                        (from + 1) * this.hashLength
+                    ),
+                    to * this.hashLength
+                );
+        });
+        return index;
+    }
+}
+
+export default AssetIndex;
@@ -0,0 +1,101 @@
+import path from "path";
+import fs from "fs/promises";
+import { constants } from "fs";
+import { hashFile } from "./hashPool.js";
+import { getHashAlgorithm } from "./utils.js";
+
+const fallbackCodes = ["EXDEV", "EPERM", "EMLINK", "ENOTSUP"];
+
+export const linkFile = async (src, dest) => {
+    try {
+        await fs.link(src, dest);
+    } catch (e) {
+        if (!fallbackCodes.includes(e.code)) throw e;
+        // reflink where the filesystem supports it, plain copy otherwise
+        await fs.copyFile(
+            src,
+            dest,
+            constants.COPYFILE_FICLONE | constants.COPYFILE_EXCL
+        );
+    }
+};
+
+// blobs are recorded in the download state under this version, so a blob
+// whose mtime changed since it was verified is hashed again before use
+const storeVersion = ".store";
+
+class AssetStore {
+    constructor(storePath, state) {
+        this.storePath = storePath;
+        this.state = state;
+        this.pending = new Map();
+        this.disabled = false;
+    }
+
+    blobPath(hash) {
+        return path.join(this.storePath, hash.slice(0, 2), hash);
+    }
+
+    // a blob of the wrong size or hash was damaged through one of its links
+    async link(hash, dest, size) {
+        if (this.disabled) return false;
+        const blobPath = this.blobPath(hash);
+        let stats;
+        try {
+            stats = await fs.stat(blobPath);
+        } catch (e) {
+            return false;
+        }
+        if (stats.size !== size) return false;
+        const blob = { name: hash, hash };
+        if (!this.state.check(storeVersion, blob, stats)) {
+            const digest = await hashFile(blobPath, getHashAlgorithm(hash));
+            if (digest !== hash) return false;
+            await this.state.record(storeVersion, blob, blobPath);
+        }
+        await fs.unlink(dest).catch(() => {});
+        await linkFile(blobPath, dest);
+        return true;
+    }
+
+    // only hard links are stored; where the filesystem has none, copies
+    // would double the disk use, so the store turns itself off instead
+    async add(hash, src, replace) {
+        if (this.disabled) return;
+        const blobPath = this.blobPath(hash);
+        await fs.mkdir(path.dirname(blobPath), { recursive: true });
+        if (replace) await fs.unlink(blobPath).catch(() => {});
+        try {
+            await fs.link(src, blobPath);
+        } catch (e) {
+            if (e.code === "EEXIST" || e.code === "EMLINK") return;
+            if (!fallbackCodes.includes(e.code)) throw e;
+            this.disabled = true;
+            return;
+        }
+        await this.state.record(storeVersion, { name: hash, hash }, blobPath);
+    }
+
+    // links the blob of hash and size to dest, or calls download to write
+    // dest and adds the result to the store; concurrent calls for the same
+    // hash wait for the first one instead of fetching the same bytes again
+    async materialize(hash, size, dest, download) {
+        while (this.pending.has(hash))
+            await this.pending.get(hash).catch(() => {});
+
+        const task = (async () => {
+            if (await this.link(hash, dest, size)) return false;
+            await download();
+            await this.add(hash, dest, true);
+            return true;
+        })();
+        this.pending.set(hash, task);
+        try {
+            return await task;
+        } finally {
+            this.pending.delete(hash);
+        }
+    }
+}
+
+export default AssetStore;
@@ -0,0 +1,54 @@
+import { transportStats } from "./transport.js";
+
+// AIMD controller for the number of downloads in flight. Every window of
+// finished downloads it compares throughput and average time to response
+// headers with the previous window: one more slot while throughput keeps
+// rising and latency stays near the best seen, one less once requests queue
+// up and latency grows, and half as many after errors or 5xx/429.
+class ConcurrencyController {
+    constructor(max, initial) {
+        this.max = max;
+        this.limit = Math.min(initial, max);
+        this.throughput = 0;
+        this.minLatency = Infinity;
+        this.startWindow();
+    }
+
+    startWindow() {
+        this.windowStart = Date.now();
+        this.bytes = 0;
+        this.completed = 0;
+        this.failures = transportStats.failures;
+        this.responses = transportStats.responses;
+        this.latency = transportStats.latency;
+    }
+
+    record(bytes) {
+        this.bytes += bytes;
+        this.completed++;
+        const elapsed = Date.now() - this.windowStart;
+        if (this.completed < this.limit || elapsed < 250) return;
+
+        const throughput = this.bytes / elapsed;
+        const responses = transportStats.responses - this.responses;
+        const latency =
+            responses > 0
+                ? (transportStats.latency - this.latency) / responses
+                : this.minLatency;
+        this.minLatency = Math.min(this.minLatency, latency);
+
+        if (transportStats.failures > this.failures)
+            this.limit = Math.max(1, Math.floor(this.limit / 2));
+        else if (
+            throughput > this.throughput * 1.05 &&
+            latency <= this.minLatency * 1.2
+        )
+            this.limit = Math.min(this.max, this.limit + 1);
+        else if (latency > this.minLatency * 1.5)
+            this.limit = Math.max(1, this.limit - 1);
+        this.throughput = throughput;
+        this.startWindow();
+    }
+}
+
+export default ConcurrencyController;
@@ -0,0 +1,31 @@
+const UNCHANGED = 0;
+const ADDED = 1;
+const CHANGED = 2;
+
+// compares two asset indexes by name and hash; sizes are byte totals of the
+// target for added and changed assets and of the base for removed ones
+const diffManifests = (base, target) => {
+    const status = new Uint8Array(target.length);
+    for (let i = 0; i < target.length; i++) {
+        const j = base.indexOf(target.get(i).name);
+        if (j === -1) status[i] = ADDED;
+        else if (base.hash(j) !== target.hash(i)) status[i] = CHANGED;
+        else status[i] = UNCHANGED;
+    }
+
+    const added = target.filter((asset, i) => status[i] === ADDED);
+    const changed = target.filter((asset, i) => status[i] === CHANGED);
+    const unchanged = target.filter((asset, i) => status[i] === UNCHANGED);
+    const removed = base.filter(asset => target.indexOf(asset.name) === -1);
+    return {
+        added,
+        changed,
+        unchanged,
+        removed,
+        addedSize: added.totalSize(),
+        changedSize: changed.totalSize(),
+        removedSize: removed.totalSize()
+    };
+};
+
+export default diffManifests;
@@ -1,99 +1,485 @@
 import path from "path";
-import chalk from "chalk";
 import fs from "fs/promises";
-import Promise from "bluebird";
 import logUpdate from "log-update";
 import { sprintf } from "sprintf-js";
-import { Presets, SingleBar } from "cli-progress";
-import getDownloadList from "./getDownloadList.js";
+import AssetStore, { linkFile } from "./assetStore.js";
+import ConcurrencyController from "./concurrencyController.js";
+import DownloadState from "./downloadState.js";
+import Hedger from "./hedger.js";
+import diffManifests from "./diffManifests.js";
+import { emit } from "./events.js";
+import getAssetList from "./getAssetList.js";
+import DownloadProgress from "./progress.js";
+import WorkQueue from "./workQueue.js";
+import { hashFile } from "./hashPool.js";
 import {
-    fetchWithRetry,
-    getBufferChecksum,
-    getResponseAssetHash
+    downloadFile,
+    downloadFileSegmented,
+    formatBytes,
+    getHashAlgorithm
 } from "./utils.js";
 
-const downloadAssets = async (assetList, args, i18n) => {
-    const downloadList = await getDownloadList(assetList, args, i18n);
-    const bar = new SingleBar(
-        {
-            clearOnComplete: true,
-            format: `${chalk.blue("{bar}")} {file} | {value}/{total}`,
-            stopOnComplete: true
-        },
-        Presets.shades_classic
-    );
-    if (!args.dryRun && !args.checksum)
+const verifyAsset = async (filePath, asset) => {
+    let stats;
+    try {
+        stats = await fs.stat(filePath);
+    } catch (e) {
+        return "missing";
+    }
+    if (stats.size < asset.size) return "truncated";
+    if (
+        stats.size > asset.size ||
+        (await hashFile(filePath, getHashAlgorithm(asset.hash))) !== asset.hash
+    )
+        return "corrupt";
+    return undefined;
+};
+
+const downloadAssets = async (manifestList, args, i18n) => {
+    if (!args.dryRun && (!args.checksum || args.repair))
         try {
             await fs.mkdir(args.outputPath, { recursive: true });
-        } catch (e) {}
-    for (const assetVersion of downloadList) {
+        } catch (e) {
+            if (e.code === "EACCES") {
+                console.error(sprintf(i18n.eaccesText, args.outputPath));
+                process.exit(1);
+            }
+        }
+    const writing = !args.dryRun && (!args.checksum || args.repair);
+    // before the scan, so a bad report path fails at once and not after it
+    if (args.checksum)
+        try {
+            await fs.mkdir(path.dirname(args.report), { recursive: true });
+        } catch (e) {
+            if (e.code === "EACCES") {
+                console.error(sprintf(i18n.eaccesText, args.report));
+                process.exit(1);
+            }
+            throw e;
+        }
+    let state;
+    if (writing) {
+        state = new DownloadState(path.join(args.outputPath, ".state"));
+        await state.open();
+    }
+    const store =
+        args.dedup && writing
+            ? new AssetStore(path.join(args.outputPath, ".store"), state)
+            : undefined;
+
+    const phase = args.checksum ? "checksum" : "download";
+    const start = Date.now();
+    emit("phase", { phase, status: "start" });
+    if (!args.json)
+        logUpdate(
+            sprintf(
+                args.checksum
+                    ? i18n.checksummingAssets
+                    : i18n.downloadingAssets,
+                args.outputPath
+            )
+        );
+    const progress = args.json
+        ? undefined
+        : new DownloadProgress(manifestList.length, args.checksum, i18n);
+
+    const batchSize = parseInt(args.batchSize, 10);
+    const controller =
+        args.adaptive && !args.checksum
+            ? new ConcurrencyController(batchSize, 4)
+            : { limit: batchSize, record: () => {} };
+    const report = {
+        checked: 0,
+        missing: [],
+        truncated: [],
+        corrupt: [],
+        repaired: [],
+        failed: []
+    };
+    // skip checks, hashing and links run at the --batch-size ceiling, only
+    // network transfers are held to the adaptive limit
+    const workQueue = new WorkQueue(() => batchSize);
+    const transfers = new WorkQueue(() => controller.limit);
+    const hedger = args.hedge
+        ? new Hedger(
+              parseFloat(args.hedgePercentile),
+              parseFloat(args.hedgeBudget) / 100
+          )
+        : undefined;
+
+    // a file of the --since version is reused only when its size matches and
+    // it is recorded as current or hashes right, since a damaged one would
+    // be copied into every new version and never repaired
+    const isIntact = async (version, asset, filePath) => {
+        const stats = await fs.stat(filePath).catch(() => undefined);
+        if (stats === undefined || stats.size !== asset.size) return false;
+        if (args.dryRun || (state && state.check(version, asset, stats)))
+            return true;
+        const hash = await hashFile(
+            filePath,
+            getHashAlgorithm(asset.hash)
+        ).catch(() => undefined);
+        return hash === asset.hash;
+    };
+
+    // resolves how the asset was handled: downloaded, linked from the store
+    // or the --since version, skipped as current, or its checksum result
+    const processAsset = async ({
+        assetVersion,
+        assetListItem,
+        baseFile,
+        onData
+    }) => {
         const outputPath = path.join(args.outputPath, assetVersion);
-        if (args.checksum)
-            logUpdate(sprintf(i18n.checksummingAssets, outputPath));
-        else logUpdate(sprintf(i18n.downloadingAssets, outputPath));
-        if (!args.dryRun && !args.checksum)
+        let dataURL = args.dataURLBase + `${assetVersion}/production/`;
+        dataURL += assetVersion < 70000 ? "2017v1" : "2018v1";
+        dataURL += `/Android/${assetListItem.file}`;
+        const filePath = path.join(outputPath, assetListItem.name);
+        const transfer = async () => {
+            const segmentThreshold = args.segmentThreshold * 1024 * 1024;
+            const segments = parseInt(args.segments, 10);
+            const saved =
+                segments > 1 && assetListItem.size > segmentThreshold
+                    ? await downloadFileSegmented(
+                          dataURL,
+                          filePath,
+                          assetListItem.size,
+                          segments,
+                          onData
+                      )
+                    : hedger
+                    ? await hedger.run((options, hedge) =>
+                          downloadFile(dataURL, filePath, {
+                              ...options,
+                              onData: bytes => {
+                                  options.onData(bytes);
+                                  onData(bytes);
+                              },
+                              partPath: hedge ? `${filePath}.hedge` : undefined
+                          })
+                      )
+                    : await downloadFile(dataURL, filePath, { onData });
+            if (!saved)
+                throw new Error(
+                    sprintf(i18n.checksumFailed, assetListItem.name)
+                );
+        };
+        const download = () => transfers.push(transfer);
+        // checksum mode trusts the manifest hash and only uses the network
+        // to repair
+        if (args.checksum) {
+            const problem = await verifyAsset(filePath, assetListItem);
+            report.checked++;
+            if (problem === undefined) return "verified";
+            const entry = {
+                version: assetVersion,
+                name: assetListItem.name,
+                file: assetListItem.file,
+                size: assetListItem.size,
+                hash: assetListItem.hash
+            };
+            report[problem].push(entry);
+            if (!args.repair) return problem;
             try {
-                await fs.mkdir(outputPath, { recursive: true });
+                // never write through a hardlink into shared blobs
+                await fs.unlink(filePath).catch(() => {});
+                await download();
+                if (store) await store.add(assetListItem.hash, filePath, true);
+                if (state)
+                    await state.record(assetVersion, assetListItem, filePath);
+                report.repaired.push(entry);
+                return "repaired";
+            } catch (e) {
+                report.failed.push({ ...entry, error: e.message });
+                // recorded in the report, the scan goes on
+                e.reported = true;
+                throw e;
+            }
+        }
+        // quick check: a single stat sends missing or wrong-size files
+        // straight to download, only files of the manifest size are trusted
+        // by their recorded mtime or hashed
+        const stats = await fs.stat(filePath).catch(() => undefined);
+        const sized = stats !== undefined && stats.size === assetListItem.size;
+        if (sized && state && state.check(assetVersion, assetListItem, stats))
+            return "skipped";
+        // unchanged since the --since version, reuse its file
+        if (
+            baseFile !== undefined &&
+            (await isIntact(args.since, assetListItem, baseFile))
+        )
+            try {
+                if (!args.dryRun) {
+                    await fs.unlink(filePath).catch(() => {});
+                    await linkFile(baseFile, filePath);
+                    if (state)
+                        await state.record(
+                            assetVersion,
+                            assetListItem,
+                            filePath
+                        );
+                }
+                return "linked";
+            } catch (e) {}
+        if (sized && !args.dryRun)
+            try {
+                const hash = await hashFile(
+                    filePath,
+                    getHashAlgorithm(assetListItem.hash)
+                );
+                if (hash === assetListItem.hash) {
+                    if (store)
+                        await store.add(assetListItem.hash, filePath);
+                    if (state)
+                        await state.record(
+                            assetVersion,
+                            assetListItem,
+                            filePath
+                        );
+                    return "skipped";
+                }
+            } catch (e) {}
+        let downloaded = true;
+        if (args.dryRun) {
+            const matched = await transfers.push(() =>
+                downloadFile(dataURL, undefined, { onData })
+            );
+            if (!matched)
+                throw new Error(
+                    sprintf(i18n.checksumFailed, assetListItem.name)
+                );
+        } else if (store)
+            downloaded = await store.materialize(
+                assetListItem.hash,
+                assetListItem.size,
+                filePath,
+                download
+            );
+        else await download();
+        if (downloaded) controller.record(assetListItem.size);
+        if (state)
+            await state.record(assetVersion, assetListItem, filePath);
+        return downloaded ? "downloaded" : "linked";
+    };
+    const totals = { files: 0, failed: 0, received: 0 };
+    let failure;
+    // processes one asset and reports it to the progress bars or as an event
+    const handleAsset = async (assetVersion, assetListItem, baseFile) => {
+        const assetStart = Date.now();
+        let received = 0;
+        const track = progress
+            ? progress.track(assetVersion, assetListItem)
+            : () => {};
+        const onData = bytes => {
+            received += bytes;
+            track(bytes);
+        };
+        const event = {
+            version: parseInt(assetVersion, 10),
+            name: assetListItem.name,
+            size: assetListItem.size
+        };
+        try {
+            const status = await processAsset({
+                assetVersion,
+                assetListItem,
+                baseFile,
+                onData
+            });
+            if (progress) progress.done(assetVersion, assetListItem);
+            totals.files++;
+            totals.received += received;
+            emit("asset", {
+                ...event,
+                status,
+                bytes: received,
+                ms: Date.now() - assetStart
+            });
+        } catch (e) {
+            if (progress) progress.failed(assetVersion, assetListItem);
+            totals.failed++;
+            emit("asset", {
+                ...event,
+                status: "failed",
+                bytes: received,
+                ms: Date.now() - assetStart,
+                error: e.message
+            });
+            if (e.reported) return;
+            // errors outside a repair still belong in the report
+            if (args.checksum)
+                report.failed.push({
+                    version: assetVersion,
+                    name: assetListItem.name,
+                    file: assetListItem.file,
+                    size: assetListItem.size,
+                    hash: assetListItem.hash,
+                    error: e.message
+                });
+            if (failure === undefined) failure = e;
+        }
+    };
+    // assets are scheduled as soon as their manifest is decoded, so downloads
+    // start while the remaining manifests are still being fetched, and every
+    // selected version feeds the same pool across version boundaries
+    let base;
+    if (args.sinceManifest !== undefined && !args.checksum)
+        base = (
+            await getAssetList([args.sinceManifest], args, i18n, async () => {})
+        )[args.sinceManifest.version];
+    // filters apply before anything is counted or scheduled, and to the
+    // --since version too so the diff compares like with like
+    const select = assets =>
+        args.assetFilter ? assets.filter(args.assetFilter) : assets;
+    if (base !== undefined) base = select(base);
+    const diffs = [];
+    await getAssetList(manifestList, args, i18n, async (manifest, all) => {
+        const assetVersion = manifest.version.toString();
+        const assets = select(all);
+        if (writing)
+            try {
+                await fs.mkdir(path.join(args.outputPath, assetVersion), {
+                    recursive: true
+                });
             } catch (e) {
                 if (e.code === "EACCES") {
                     console.error(sprintf(i18n.eaccesText, args.outputPath));
                     process.exit(1);
                 }
             }
-        bar.start(assetList[assetVersion].length, 0);
-        await Promise.map(
-            assetList[assetVersion],
-            async assetListItem => {
-                let dataURL = args.dataURLBase + `${assetVersion}/production/`;
-                dataURL += assetVersion < 70000 ? "2017v1" : "2018v1";
-                dataURL += `/Android/${assetListItem.file}`;
-                if (!args.dryRun || args.checksum)
-                    try {
-                        const res = await fetchWithRetry(dataURL, "HEAD");
-                        const buf = await fs.readFile(
-                            `./${args.outputPath}/${assetVersion}/${assetListItem.name}`
-                        );
-                        if (
-                            getResponseAssetHash(res) === getBufferChecksum(buf)
-                        ) {
-                            bar.increment(1, { file: assetListItem.name });
-                            return;
-                        } else if (args.checksum) {
-                            console.error(
-                                sprintf(i18n.checksumFailed, manifest.indexName)
-                            );
-                            process.exit(1);
-                        }
-                    } catch (e) {}
-                const res = await fetchWithRetry(dataURL);
-                const buf = await res.buffer();
-                if (getResponseAssetHash(res) !== getBufferChecksum(buf)) {
-                    console.error(
-                        sprintf(i18n.checksumFailed, manifest.indexName)
+        if (progress) {
+            progress.addVersion(assetVersion, assets);
+            progress.manifestDone(manifest);
+        }
+        emit("manifest", {
+            version: manifest.version,
+            files: assets.length,
+            size: assets.totalSize()
+        });
+        // assets are read from the index only when a slot is close to free,
+        // and waiting here also holds back the next manifests
+        const schedule = async (index, linked) => {
+            for (let i = 0; i < index.length; i++) {
+                await workQueue.ready();
+                workQueue.push(() => {
+                    const assetListItem = index.get(i);
+                    return handleAsset(
+                        assetVersion,
+                        assetListItem,
+                        linked
+                            ? path.join(
+                                  args.outputPath,
+                                  args.since,
+                                  assetListItem.name
+                              )
+                            : undefined
                     );
-                    process.exit(1);
-                }
-                if (!args.dryRun)
-                    await fs.writeFile(
-                        path.join(outputPath, assetListItem.name),
-                        buf
-                    );
-                bar.increment(1, { file: assetListItem.name });
-            },
-            { concurrency: parseInt(args.batchSize, 10) }
-        );
+                });
+            }
+        };
+        if (base === undefined || assetVersion === args.since)
+            await schedule(assets, false);
+        else {
+            const diff = diffManifests(base, assets);
+            diffs.push({ assetVersion, diff });
+            await schedule(diff.unchanged, true);
+            await schedule(diff.added, false);
+            await schedule(diff.changed, false);
+        }
+    });
+    await workQueue.drained();
 
-        bar.stop();
+    if (progress) progress.stop();
+    if (state) await state.close();
+    const seconds = (Date.now() - start) / 1000;
+    emit("phase", {
+        phase,
+        status: failure === undefined ? "done" : "failed",
+        ms: Date.now() - start,
+        ...totals,
+        bytesPerSecond: seconds > 0 ? Math.round(totals.received / seconds) : 0
+    });
+    // the report is written even when the run fails
+    if (args.checksum)
+        await fs.writeFile(args.report, JSON.stringify(report, null, 4));
+    if (failure !== undefined) throw failure;
+    if (args.json) {
         if (args.checksum)
-            logUpdate(
-                sprintf(`${i18n.checksummingAssets} ${i18n.done}`, outputPath)
-            );
-        else
-            logUpdate(
-                sprintf(`${i18n.downloadingAssets} ${i18n.done}`, outputPath)
-            );
-        logUpdate.done();
+            emit("checksum", {
+                checked: report.checked,
+                missing: report.missing.length,
+                truncated: report.truncated.length,
+                corrupt: report.corrupt.length,
+                repaired: report.repaired.length,
+                failed: report.failed.length,
+                report: args.report
+            });
+        if (hedger)
+            emit("hedge", {
+                hedged: hedger.hedges,
+                downloads: hedger.downloads,
+                won: hedger.wins
+            });
+        for (const { assetVersion, diff } of diffs)
+            emit("diff", {
+                version: +assetVersion,
+                since: +args.since,
+                added: diff.added.length,
+                addedSize: diff.addedSize,
+                changed: diff.changed.length,
+                changedSize: diff.changedSize,
+                removed: diff.removed.length,
+                removedSize: diff.removedSize
+            });
+        return report;
     }
+
+    if (args.checksum)
+        logUpdate(
+            sprintf(`${i18n.checksummingAssets} ${i18n.done}`, args.outputPath)
+        );
+    else
+        logUpdate(
+            sprintf(`${i18n.downloadingAssets} ${i18n.done}`, args.outputPath)
+        );
+    logUpdate.done();
+    if (args.checksum)
+        console.log(
+            sprintf(
+                i18n.checksumSummary,
+                report.checked,
+                report.missing.length,
+                report.truncated.length,
+                report.corrupt.length,
+                report.repaired.length,
+                report.failed.length,
+                args.report
+            )
+        );
+    if (hedger)
+        console.log(
+            sprintf(
+                i18n.hedgeSummary,
+                hedger.hedges,
+                hedger.downloads,
+                hedger.wins
+            )
+        );
+    for (const { assetVersion, diff } of diffs)
+        console.log(
+            sprintf(
+                i18n.diffSummary,
+                assetVersion,
+                diff.added.length,
+                formatBytes(diff.addedSize),
+                diff.changed.length,
+                formatBytes(diff.changedSize),
+                diff.removed.length,
+                formatBytes(diff.removedSize),
+                args.since
+            )
+        );
+    return report;
 };
 
 export default downloadAssets;
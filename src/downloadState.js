@@ -0,0 +1,70 @@
+import fs from "fs/promises";
+
+// records of finished downloads, appended as one json line per file and
+// compacted on close; a file whose size and mtime still match its record is
+// current without sending a request or reading it
+class DownloadState {
+    constructor(statePath) {
+        this.statePath = statePath;
+        this.records = new Map();
+        this.writing = Promise.resolve();
+    }
+
+    async open() {
+        try {
+            const lines = (await fs.readFile(this.statePath, "utf8")).split(
+                "\n"
+            );
+            for (const line of lines)
+                try {
+                    const record = JSON.parse(line);
+                    this.records.set(
+                        `${record.version}/${record.name}`,
+                        record
+                    );
+                } catch (e) {}
+        } catch (e) {
+            if (e.code !== "ENOENT") throw e;
+        }
+        this.handle = await fs.open(this.statePath, "a");
+    }
+
+    // stats of the file on disk, taken once by the caller
+    check(version, asset, stats) {
+        const record = this.records.get(`${version}/${asset.name}`);
+        return (
+            record !== undefined &&
+            record.hash === asset.hash &&
+            stats.size === record.size &&
+            stats.mtimeMs === record.mtime
+        );
+    }
+
+    async record(version, asset, filePath) {
+        const stats = await fs.stat(filePath);
+        const record = {
+            version,
+            name: asset.name,
+            size: stats.size,
+            mtime: stats.mtimeMs,
+            hash: asset.hash
+        };
+        this.records.set(`${version}/${asset.name}`, record);
+        this.writing = this.writing.then(() =>
+            this.handle.write(`${JSON.stringify(record)}\n`)
+        );
+        await this.writing;
+    }
+
+    async close() {
+        await this.writing;
+        await this.handle.close();
+        let data = "";
+        for (const record of this.records.values())
+            data += `${JSON.stringify(record)}\n`;
+        await fs.writeFile(`${this.statePath}.tmp`, data);
+        await fs.rename(`${this.statePath}.tmp`, this.statePath);
+    }
+}
+
+export default DownloadState;
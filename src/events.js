@@ -0,0 +1,18 @@
+let enabled = false;
+
+export const configureEvents = args => {
+    enabled = args.json === true;
+};
+
+// --json mode writes one object per line to stdout for every phase and
+// asset instead of drawing the interactive ui
+export const emit = (event, fields) => {
+    if (!enabled) return;
+    process.stdout.write(
+        `${JSON.stringify({
+            time: new Date().toISOString(),
+            event,
+            ...fields
+        })}\n`
+    );
+};
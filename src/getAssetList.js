@@ -1,117 +1,52 @@
-import chalk from "chalk";
 import Promise from "bluebird";
-import logUpdate from "log-update";
 import { sprintf } from "sprintf-js";
 import { decode } from "@msgpack/msgpack";
-import { SingleBar, Presets } from "cli-progress";
-import {
-    fetchWithRetry,
-    getBufferChecksum,
-    getResponseAssetHash
-} from "./utils.js";
-
-const getAssetList = async (args, i18n) => {
-    let manifestList = [];
-
-    logUpdate(args.latest ? i18n.getLatestManifest : i18n.getManifestList);
-    const res = await fetchWithRetry(
-        `https://api.matsurihi.me/mltd/v1/${args.locale}/version/${
-            args.latest ? "latest" : "assets"
-        }`
-    );
-    const result = await res.json();
-
-    if (!args.latest) {
-        result.forEach(manifest => {
-            let dataURL = args.dataURLBase;
-            dataURL += `${manifest.version}/production/`;
-            dataURL += manifest.version < 70000 ? "2017v1" : "2018v1";
-            dataURL += `/Android/${manifest.indexName}`;
-            manifestList.push({
-                ...manifest,
-                dataURL
-            });
-        });
-    } else {
-        const manifest = result.res;
-        let dataURL = args.dataURLBase;
-        dataURL += `${manifest.version}/production/`;
-        dataURL += manifest.version < 70000 ? "2017v1" : "2018v1";
-        dataURL += `/Android/${manifest.indexName}`;
-        manifestList.push({
-            ...manifest,
-            dataURL
-        });
-    }
-    logUpdate(
-        (args.latest ? i18n.getLatestManifest : i18n.getManifestList) +
-            i18n.done
-    );
-    logUpdate.done();
-
-    let downloaded;
-    if (args.checksum)
-        try {
-            downloaded = await (
-                await import("fs/promises")
-            ).readdir(args.outputPath);
-            manifestList = manifestList.filter(manifest =>
-                downloaded.includes(manifest.version.toString())
-            );
-        } catch (e) {
-            if (e.code === "EACCES") {
-                console.error(sprintf(i18n.eaccesText, args.outputPath));
-                process.exit(1);
-            }
-            manifestList = [];
-        }
-
-    logUpdate(i18n.downloadingManifest);
-    const bar = new SingleBar(
-        {
-            clearOnComplete: true,
-            format:
-                chalk.red("{bar}") +
-                " {file} (asset {version}) | {value}/{total}"
-        },
-        Presets.shades_classic
-    );
-    if (!args.latest) bar.start(manifestList.length, 0);
+import AssetIndex from "./assetIndex.js";
+import { readManifest, writeManifest } from "./manifestCache.js";
+import { hashBuffer } from "./hashPool.js";
+import { fetchOnce, getResponseAssetHash, withRetry } from "./utils.js";
+
+// calls onManifest with each decoded manifest as soon as it is ready, while
+// the next ones are still being fetched
+const getAssetList = async (manifestList, args, i18n, onManifest) => {
     const assetList = {};
 
     await Promise.map(
         manifestList,
         async manifest => {
-            const res = await fetchWithRetry(manifest.dataURL);
-            const buf = await res.buffer();
-            if (getResponseAssetHash(res) !== getBufferChecksum(buf))
-                throw new Error(
-                    sprintf(i18n.checksumFailed, manifest.indexName)
-                );
-
+            let buf = await readManifest(manifest, args);
+            const cached = buf !== undefined;
+            let digest;
+            // a broken transfer or checksum fetches the manifest again
+            if (!cached)
+                ({ digest, buf } = await withRetry(async () => {
+                    const res = await fetchOnce(manifest.dataURL);
+                    const hashed = await hashBuffer(await res.buffer());
+                    if (getResponseAssetHash(res) !== hashed.digest)
+                        throw new Error(
+                            sprintf(i18n.checksumFailed, manifest.indexName)
+                        );
+                    return hashed;
+                }));
+
+            // each entry is name: [hash, download file name, size]
             const [result] = decode(buf);
-            assetList[manifest.version] = [];
-            for (const key of Object.keys(result))
-                assetList[manifest.version].push({
-                    name: key, // asset name
-                    hash: result[key][0], // file hash
-                    file: result[key][1], // download file name
-                    size: result[key][2] // file size
-                });
-            if (!args.latest)
-                bar.increment(1, {
-                    file: manifest.indexName,
-                    version: manifest.version
-                });
+            assetList[manifest.version] = AssetIndex.fromManifest(result);
+            if (!cached && !args.dryRun)
+                await writeManifest(
+                    manifest,
+                    buf,
+                    digest,
+                    assetList[manifest.version],
+                    args
+                );
+            await onManifest(manifest, assetList[manifest.version]);
         },
         {
-            concurrency: parseInt(args.batchSize, 10)
+            concurrency: parseInt(args.manifestConcurrency, 10)
         }
     );
 
-    if (!args.latest) bar.stop();
-    logUpdate(`${i18n.downloadingManifest} ${i18n.done}`);
-    logUpdate.done();
     return assetList;
 };
 
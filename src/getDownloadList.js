@@ -1,9 +1,90 @@
 import inquirer from "inquirer";
+import { sprintf } from "sprintf-js";
+import { decode } from "@msgpack/msgpack";
+import AssetIndex from "./assetIndex.js";
+import { readManifest, readManifestIndex } from "./manifestCache.js";
 import { formatBytes } from "./utils.js";
 
-const getDownloadList = async (assetList, args, i18n) => {
-    const assetVersions = Object.keys(assetList);
-    if (assetVersions.length === 1 || args.checksum) return assetVersions;
+// --versions 70000-75000,80010 as a list of inclusive [from, to] ranges
+const parseVersions = (versions, i18n) =>
+    versions.split(",").map(part => {
+        const match = part.trim().match(/^(\d+)(?:-(\d+))?$/);
+        if (!match) throw new Error(sprintf(i18n.invalidVersions, part));
+        return [parseInt(match[1], 10), parseInt(match[2] ?? match[1], 10)];
+    });
+
+const selectVersions = (manifestList, args, i18n) => {
+    if (args.all) return manifestList;
+    if (args.last !== undefined) {
+        const last = parseInt(args.last, 10);
+        if (!(last > 0)) throw new Error(sprintf(i18n.invalidLast, args.last));
+        // the api order is not guaranteed, newest means highest version
+        return [...manifestList]
+            .sort((a, b) => a.version - b.version)
+            .slice(-last);
+    }
+    const ranges = parseVersions(args.versions, i18n);
+    // a single version that does not exist is most likely a typo
+    for (const [from, to] of ranges)
+        if (
+            from === to &&
+            !manifestList.some(manifest => manifest.version === from)
+        )
+            throw new Error(sprintf(i18n.versionNotFound, from));
+    const selected = manifestList.filter(manifest =>
+        ranges.some(
+            ([from, to]) => manifest.version >= from && manifest.version <= to
+        )
+    );
+    if (selected.length === 0)
+        throw new Error(sprintf(i18n.noVersionMatches, args.versions));
+    return selected;
+};
+
+// files and bytes of a cached manifest; with filters the cached manifest is
+// decoded so the prompt shows what would actually be downloaded
+const countAssets = async (manifest, args) => {
+    if (args.assetFilter === undefined)
+        return await readManifestIndex(manifest, args);
+    const buf = await readManifest(manifest, args);
+    if (buf === undefined) return undefined;
+    const [result] = decode(buf);
+    const assets = AssetIndex.fromManifest(result).filter(args.assetFilter);
+    return { files: assets.length, size: assets.totalSize() };
+};
+
+const getDownloadList = async (manifestList, args, i18n) => {
+    const selectors = [args.latest, args.versions, args.last, args.all];
+    if (selectors.filter(selector => selector !== undefined).length > 1)
+        throw new Error(i18n.selectorConflict);
+    if (
+        args.versions !== undefined ||
+        args.last !== undefined ||
+        args.all !== undefined
+    )
+        return selectVersions(manifestList, args, i18n);
+    if (manifestList.length === 1 || args.checksum) return manifestList;
+    // nobody can answer a prompt in --json mode
+    if (args.json) throw new Error(i18n.noVersionSelected);
+
+    const choices = await Promise.all(
+        [...manifestList].reverse().map(async manifest => {
+            let name = manifest.version.toString();
+            const details = [];
+            if (manifest.updatedAt)
+                details.push(
+                    new Date(manifest.updatedAt).toLocaleDateString()
+                );
+            const index = await countAssets(manifest, args);
+            if (index !== undefined)
+                details.push(
+                    `${index.files} ${i18n.file}`,
+                    formatBytes(index.size)
+                );
+            if (details.length > 0) name += ` (${details.join(", ")})`;
+            return { name, value: manifest };
+        })
+    );
 
     let confirm, answers;
     while (!confirm) {
@@ -13,17 +94,7 @@ const getDownloadList = async (assetList, args, i18n) => {
                 name: "downloadList",
                 pageSize: 15,
                 message: i18n.downloadMessage,
-                choices: assetVersions.reverse().map(a => {
-                    const name = `${a} (${assetList[a].length} ${
-                        i18n.file
-                    }, ${formatBytes(
-                        assetList[a].reduce(
-                            (size, asset) => size + asset.size,
-                            0
-                        )
-                    )})`;
-                    return { name, value: a };
-                }),
+                choices,
                 loop: false
             }
         ]);
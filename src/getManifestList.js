@@ -0,0 +1,136 @@
+import fs from "fs/promises";
+import logUpdate from "log-update";
+import { sprintf } from "sprintf-js";
+import { emit } from "./events.js";
+import { readVersionList, writeVersionList } from "./manifestCache.js";
+import { fetchOnce, withRetry } from "./utils.js";
+
+const getDownloadedVersions = async (args, i18n) => {
+    try {
+        return (await fs.readdir(args.outputPath)).filter(name =>
+            /^\d+$/.test(name)
+        );
+    } catch (e) {
+        if (e.code === "EACCES") {
+            console.error(sprintf(i18n.eaccesText, args.outputPath));
+            process.exit(1);
+        }
+        return [];
+    }
+};
+
+// the full list comes sorted by version, whatever order the api uses
+const fetchVersionList = (args, latest) =>
+    withRetry(async () => {
+        const res = await fetchOnce(
+            `${args.apiURLBase}mltd/v1/${args.locale}/version/${
+                latest ? "latest" : "assets"
+            }`
+        );
+        const result = await res.json();
+        return latest ? result : result.sort((a, b) => a.version - b.version);
+    });
+
+// the newest version by number, as lists cached by older runs may be unsorted
+const latestOf = versionList =>
+    versionList.reduce(
+        (latest, manifest) =>
+            manifest.version > latest[0].version ? [manifest] : latest,
+        versionList.slice(0, 1)
+    );
+
+// the cached list with manifest added or replaced, so --latest runs still
+// leave every version they downloaded in it
+const mergeVersion = (versionList, manifest) =>
+    [
+        ...(versionList ?? []).filter(
+            cached => cached.version !== manifest.version
+        ),
+        manifest
+    ].sort((a, b) => a.version - b.version);
+
+const withDataURL = (manifest, args) => {
+    let dataURL = args.dataURLBase;
+    dataURL += `${manifest.version}/production/`;
+    dataURL += manifest.version < 70000 ? "2017v1" : "2018v1";
+    dataURL += `/Android/${manifest.indexName}`;
+    return { ...manifest, dataURL };
+};
+
+// the --since version need not be among the selected ones, e.g. with
+// --latest, so it is looked up in the cached and then the full version list
+export const findManifest = async (version, args) => {
+    const find = versionList =>
+        versionList?.find(manifest => `${manifest.version}` === version);
+    let manifest = find(await readVersionList(args));
+    if (manifest === undefined) {
+        const versionList = await fetchVersionList(args, false);
+        if (!args.dryRun) await writeVersionList(versionList, args);
+        manifest = find(versionList);
+    }
+    return manifest && withDataURL(manifest, args);
+};
+
+const getManifestList = async (args, i18n) => {
+    let manifestList = [];
+    const downloaded = args.checksum
+        ? await getDownloadedVersions(args, i18n)
+        : undefined;
+
+    const start = Date.now();
+    emit("phase", { phase: "manifestList", status: "start" });
+    if (!args.json)
+        logUpdate(args.latest ? i18n.getLatestManifest : i18n.getManifestList);
+    // checksum runs work from the cached version list without any request
+    // as long as it knows every downloaded version
+    let versionList = args.checksum ? await readVersionList(args) : undefined;
+    if (
+        versionList !== undefined &&
+        downloaded.every(version =>
+            versionList.some(manifest => `${manifest.version}` === version)
+        )
+    ) {
+        if (args.latest) versionList = latestOf(versionList);
+    } else
+        try {
+            const result = await fetchVersionList(args, args.latest);
+            versionList = args.latest ? [result.res] : result;
+            if (!args.dryRun)
+                await writeVersionList(
+                    args.latest
+                        ? mergeVersion(await readVersionList(args), result.res)
+                        : versionList,
+                    args
+                );
+        } catch (e) {
+            // fall back to the version list of the last run when offline
+            versionList = await readVersionList(args);
+            if (versionList === undefined) throw e;
+            if (args.latest) versionList = latestOf(versionList);
+        }
+
+    for (const manifest of versionList)
+        manifestList.push(withDataURL(manifest, args));
+    if (!args.json) {
+        logUpdate(
+            (args.latest ? i18n.getLatestManifest : i18n.getManifestList) +
+                i18n.done
+        );
+        logUpdate.done();
+    }
+
+    if (args.checksum)
+        manifestList = manifestList.filter(manifest =>
+            downloaded.includes(manifest.version.toString())
+        );
+    emit("phase", {
+        phase: "manifestList",
+        status: "done",
+        ms: Date.now() - start,
+        versions: manifestList.length
+    });
+
+    return manifestList;
+};
+
+export default getManifestList;
@@ -0,0 +1,102 @@
+import os from "os";
+import { Worker } from "worker_threads";
+
+// inlined so the worker survives bundling into a single file
+const workerSource = `
+const crypto = require("crypto");
+const fs = require("fs");
+const { parentPort } = require("worker_threads");
+
+parentPort.on("message", ({ algorithm, file, buffer }) => {
+    const hash = crypto.createHash(algorithm);
+    if (file === undefined) {
+        hash.update(new Uint8Array(buffer));
+        parentPort.postMessage({ digest: hash.digest("hex"), buffer }, [
+            buffer
+        ]);
+        return;
+    }
+    fs.createReadStream(file)
+        .on("data", chunk => hash.update(chunk))
+        .on("error", e =>
+            parentPort.postMessage({ error: e.message, code: e.code })
+        )
+        .on("end", () =>
+            parentPort.postMessage({ digest: hash.digest("hex") })
+        );
+});
+`;
+
+const size = Math.max(1, os.cpus().length);
+const idle = [];
+const queue = [];
+// the job each busy worker is running, a worker takes one at a time
+const running = new Map();
+let workers = 0;
+
+const dispatch = worker => {
+    const job = queue.shift();
+    if (job === undefined) {
+        // idle workers must not keep the process alive
+        worker.unref();
+        idle.push(worker);
+        return;
+    }
+    worker.ref();
+    running.set(worker, job);
+    worker.postMessage(job.message, job.transfer);
+};
+
+const spawn = () => {
+    const worker = new Worker(workerSource, { eval: true });
+    worker.on("message", ({ digest, buffer, error, code }) => {
+        const { resolve, reject } = running.get(worker);
+        running.delete(worker);
+        if (error !== undefined)
+            reject(Object.assign(new Error(error), { code }));
+        else
+            resolve(
+                buffer === undefined
+                    ? digest
+                    : { digest, buf: Buffer.from(buffer) }
+            );
+        dispatch(worker);
+    });
+    // only the job of the crashed worker fails; a replacement takes over
+    // the queue, which would otherwise wait for the next run()
+    worker.on("error", e => {
+        workers--;
+        const job = running.get(worker);
+        running.delete(worker);
+        if (idle.includes(worker)) idle.splice(idle.indexOf(worker), 1);
+        if (job !== undefined) job.reject(e);
+        if (queue.length > 0) dispatch(spawn());
+    });
+    workers++;
+    return worker;
+};
+
+const run = (message, transfer) =>
+    new Promise((resolve, reject) => {
+        queue.push({
+            message,
+            transfer,
+            resolve,
+            reject
+        });
+        const worker = idle.pop() ?? (workers < size ? spawn() : undefined);
+        if (worker !== undefined) dispatch(worker);
+    });
+
+// moves the memory of buf to a worker and back instead of copying it, so buf
+// is unusable afterwards and the returned buf takes its place
+export const hashBuffer = (buf, algorithm = "md5") => {
+    let { buffer } = buf;
+    // pooled buffers share their memory with others and cannot be moved
+    if (buf.byteOffset !== 0 || buf.byteLength !== buffer.byteLength)
+        buffer = buffer.slice(buf.byteOffset, buf.byteOffset + buf.byteLength);
+    return run({ algorithm, buffer }, [buffer]);
+};
+
+export const hashFile = (file, algorithm = "md5") =>
+    run({ algorithm, file }, []);
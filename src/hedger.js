@@ -0,0 +1,124 @@
+const sampleSize = 256;
+const minSamples = 16;
+
+// hedged downloads: when an attempt waits longer for its first byte than
+// the given percentile of recent downloads, or runs slower than the mirrored
+// percentile of their throughput, a duplicate is started and the first to
+// finish wins while the other one is aborted. Duplicates are capped at
+// budget times the number of downloads.
+class Hedger {
+    constructor(percentile, budget) {
+        this.percentile = percentile;
+        this.budget = budget;
+        this.ttfb = [];
+        this.throughput = [];
+        this.downloads = 0;
+        this.hedges = 0;
+        this.wins = 0;
+    }
+
+    sample(samples, value) {
+        samples.push(value);
+        if (samples.length > sampleSize) samples.shift();
+    }
+
+    threshold(samples, percentile) {
+        if (samples.length < minSamples) return undefined;
+        const sorted = [...samples].sort((a, b) => a - b);
+        return sorted[
+            Math.min(
+                sorted.length - 1,
+                Math.floor((sorted.length * percentile) / 100)
+            )
+        ];
+    }
+
+    straggling(attempt) {
+        const now = Date.now();
+        if (attempt.first === undefined) {
+            const ttfb = this.threshold(this.ttfb, this.percentile);
+            return ttfb !== undefined && now - attempt.start > ttfb;
+        }
+        // give the transfer a second before judging its speed
+        const elapsed = now - attempt.first;
+        if (elapsed < 1000) return false;
+        const throughput = this.threshold(
+            this.throughput,
+            100 - this.percentile
+        );
+        return throughput !== undefined && attempt.bytes / elapsed < throughput;
+    }
+
+    record(attempt) {
+        if (attempt.first === undefined) return;
+        this.sample(this.ttfb, attempt.first - attempt.start);
+        const elapsed = Date.now() - attempt.first;
+        if (elapsed > 0) this.sample(this.throughput, attempt.bytes / elapsed);
+    }
+
+    // task({ signal, onData }, hedge) downloads once and resolves whether
+    // the file was saved; onData receives the size of every chunk
+    run(task) {
+        this.downloads++;
+        const attempts = [];
+        return new Promise((resolve, reject) => {
+            let settled = false;
+            let failure;
+            const settle = () => {
+                settled = true;
+                clearInterval(timer);
+            };
+            const launch = hedge => {
+                const controller = new AbortController();
+                const attempt = {
+                    controller,
+                    hedge,
+                    start: Date.now(),
+                    first: undefined,
+                    bytes: 0,
+                    done: false
+                };
+                const onData = bytes => {
+                    if (attempt.first === undefined) attempt.first = Date.now();
+                    attempt.bytes += bytes;
+                };
+                attempts.push(attempt);
+                task({ signal: controller.signal, onData }, hedge).then(
+                    saved => {
+                        attempt.done = true;
+                        if (settled) return;
+                        if (!saved && attempts.some(other => !other.done))
+                            return;
+                        settle();
+                        for (const other of attempts)
+                            if (other !== attempt) other.controller.abort();
+                        this.record(attempt);
+                        if (saved && hedge) this.wins++;
+                        resolve(saved);
+                    },
+                    e => {
+                        attempt.done = true;
+                        if (settled) return;
+                        if (failure === undefined) failure = e;
+                        if (attempts.some(other => !other.done)) return;
+                        settle();
+                        reject(failure);
+                    }
+                );
+            };
+            const timer = setInterval(() => {
+                if (
+                    attempts.length > 1 ||
+                    this.hedges >= this.budget * this.downloads ||
+                    !this.straggling(attempts[0])
+                )
+                    return;
+                this.hedges++;
+                launch(true);
+            }, 100);
+            launch(false);
+        });
+    }
+}
+
+export default Hedger;
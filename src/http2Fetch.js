@@ -0,0 +1,126 @@
+import http2 from "http2";
+import { Headers, Response } from "node-fetch";
+
+const sessions = new Map();
+
+// one multiplexed session per origin; streams over the limit wait in the
+// session queue instead of opening another connection. A session that got
+// GOAWAY or closed is replaced, and the streams waiting on it move over.
+const getSession = (origin, maxStreams, onConnection) => {
+    let entry = sessions.get(origin);
+    if (entry && !entry.closing) return entry;
+
+    const session = http2.connect(origin);
+    entry = {
+        session,
+        active: 0,
+        queue: [],
+        maxStreams,
+        connected: false,
+        closing: false
+    };
+    const retire = () => {
+        entry.closing = true;
+        if (sessions.get(origin) === entry) sessions.delete(origin);
+        for (const next of entry.queue.splice(0)) next(false);
+    };
+    onConnection();
+    session.on("remoteSettings", settings => {
+        entry.connected = true;
+        entry.maxStreams = Math.min(
+            maxStreams,
+            settings.maxConcurrentStreams ?? maxStreams
+        );
+    });
+    session.on("goaway", retire);
+    session.on("error", retire);
+    session.on("close", retire);
+    session.unref();
+    sessions.set(origin, entry);
+    return entry;
+};
+
+export const activeSessions = () =>
+    [...sessions.values()].filter(entry => entry.active > 0).length;
+
+// resolves whether a stream slot was taken, or false once the session is
+// going away and the caller has to start over on a new one
+const acquire = entry =>
+    new Promise(resolve => {
+        if (entry.closing) resolve(false);
+        else if (entry.active < entry.maxStreams) {
+            if (entry.active++ === 0) entry.session.ref();
+            resolve(true);
+        } else
+            entry.queue.push(taken => {
+                if (taken) entry.active++;
+                resolve(taken);
+            });
+    });
+
+const release = entry => {
+    entry.active--;
+    const next = entry.queue.shift();
+    if (next) next(true);
+    else if (entry.active === 0 && !entry.session.destroyed)
+        entry.session.unref();
+};
+
+// errors carry connected, whether the session ever received the server
+// settings; only a session that never did means the host lacks http/2
+const http2Fetch = async (url, options, maxStreams, onConnection) => {
+    const { origin, pathname, search } = new URL(url);
+    let entry;
+    let req;
+    for (;;) {
+        entry = getSession(origin, maxStreams, onConnection);
+        if (!(await acquire(entry))) continue;
+        try {
+            req = entry.session.request(
+                {
+                    ":method": options.method,
+                    ":path": pathname + search,
+                    ...options.headers
+                },
+                { endStream: true, signal: options.signal }
+            );
+            break;
+        } catch (e) {
+            release(entry);
+            // the session closed between taking the slot and the request
+            if (entry.connected && !options.signal?.aborted) {
+                entry.closing = true;
+                if (sessions.get(origin) === entry) sessions.delete(origin);
+                continue;
+            }
+            e.connected = entry.connected;
+            throw e;
+        }
+    }
+
+    return await new Promise((resolve, reject) => {
+        req.once("close", () => release(entry));
+        req.once("error", e => {
+            e.connected = entry.connected;
+            reject(e);
+        });
+        req.once("response", responseHeaders => {
+            const headers = new Headers();
+            for (const [name, value] of Object.entries(responseHeaders))
+                if (!name.startsWith(":"))
+                    headers.append(
+                        name,
+                        Array.isArray(value) ? value.join(", ") : `${value}`
+                    );
+            resolve(
+                new Response(req, {
+                    url,
+                    status: responseHeaders[":status"],
+                    headers
+                })
+            );
+        });
+    });
+};
+
+export default http2Fetch;
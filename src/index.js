@@ -1,12 +1,21 @@
 import { Command, Option } from "commander";
 import logUpdate from "log-update";
-import os from "os";
+import path from "path";
+import { sprintf } from "sprintf-js";
 import packageInfo from "../package.json";
+import createAssetFilter from "./assetFilter.js";
 import downloadAssets from "./downloadAssets.js";
-import getAssetList from "./getAssetList.js";
+import getDownloadList from "./getDownloadList.js";
+import getManifestList, { findManifest } from "./getManifestList.js";
+import { configureEvents, emit } from "./events.js";
+import { configureTransport, transportStats } from "./transport.js";
+import { configureRetry } from "./utils.js";
 
 const supportLocales = ["en-US", "zh-TW", "ko-KR"];
 
+// for options that may be given more than once
+const collect = (value, previous) => [...previous, value];
+
 const main = async () => {
     let locale = Intl.DateTimeFormat().resolvedOptions().locale;
     if (!supportLocales.includes(locale)) locale = supportLocales[0];
@@ -14,12 +23,6 @@ const main = async () => {
         await import(/* webpackMode: "eager" */ `./i18n/${locale}.json`)
     ).default;
 
-    process.on("SIGINT", () => {
-        logUpdate(i18n.sigintText);
-        logUpdate.done();
-        process.exit(1);
-    });
-
     const localeOption = new Option(
         "-L, --locale <locale>",
         i18n.cliLocale
@@ -31,27 +34,118 @@ const main = async () => {
         .description(i18n.cliDescription)
         .version(packageInfo.version, "-V, --version", i18n.cliVersion)
         .option("--latest", i18n.cliLatest)
+        .option("--versions <list>", i18n.cliVersions)
+        .option("--last <count>", i18n.cliLast)
+        .option("--all", i18n.cliAll)
         .option("--dry-run", i18n.cliDryRun)
         .option("--checksum", i18n.cliChecksum)
-        .option("-b, --batch-size <size>", i18n.cliBatchSize, os.cpus().length)
+        .option("--json", i18n.cliJson)
+        .option("--repair", i18n.cliRepair)
+        .option("--report <path>", i18n.cliReport)
+        .option("--since <version>", i18n.cliSince)
+        .option("--include <pattern>", i18n.cliInclude, collect, [])
+        .option("--exclude <pattern>", i18n.cliExclude, collect, [])
+        .option("--min-size <size>", i18n.cliMinSize)
+        .option("--max-size <size>", i18n.cliMaxSize)
+        .option("--no-dedup", i18n.cliNoDedup)
+        .option("-b, --batch-size <size>", i18n.cliBatchSize, 32)
+        .option(
+            "--manifest-concurrency <count>",
+            i18n.cliManifestConcurrency,
+            4
+        )
+        .option("--no-adaptive", i18n.cliNoAdaptive)
+        .option("--segments <count>", i18n.cliSegments, 4)
+        .option("--segment-threshold <size>", i18n.cliSegmentThreshold, 32)
+        .option("--max-sockets <count>", i18n.cliMaxSockets)
+        .option("--no-keep-alive", i18n.cliNoKeepAlive)
+        .option("--http2", i18n.cliHttp2)
+        .option("--retries <count>", i18n.cliRetries, 5)
+        .option("--connect-timeout <seconds>", i18n.cliConnectTimeout, 10)
+        .option("--read-timeout <seconds>", i18n.cliReadTimeout, 30)
+        .option("--hedge", i18n.cliHedge)
+        .option("--hedge-percentile <percent>", i18n.cliHedgePercentile, 95)
+        .option("--hedge-budget <percent>", i18n.cliHedgeBudget, 5)
         .option("-o, --output-path <path>", i18n.cliOutputPath, "./assets")
+        .option("--cache-path <path>", i18n.cliCachePath)
         .addOption(localeOption)
+        // for benchmarks against a local mock server
+        .addOption(new Option("--api-url <url>").hideHelp())
+        .addOption(new Option("--data-url <url>").hideHelp())
         .helpOption("-h, --help", i18n.cliHelp)
         .parse()
         .opts();
 
-    args.dataURLBase = `https://${
-        args.locale === "ko"
-            ? "d1jbhqydw6nrn1"
-            : args.locale === "zh"
-            ? "d3k5923sb1sy5k"
-            : ""
-    }.cloudfront.net/`;
-
-    const assetList = await getAssetList(args, i18n);
-    await downloadAssets(assetList, args, i18n);
-    if (!args.checksum) console.log(i18n.downloadComplete);
-    else console.log(i18n.checksumComplete);
+    args.apiURLBase = args.apiUrl ?? "https://api.matsurihi.me/";
+    args.dataURLBase =
+        args.dataUrl ??
+        `https://${
+            args.locale === "ko"
+                ? "d1jbhqydw6nrn1"
+                : args.locale === "zh"
+                ? "d3k5923sb1sy5k"
+                : ""
+        }.cloudfront.net/`;
+    if (args.cachePath === undefined)
+        args.cachePath = path.join(args.outputPath, ".cache");
+    if (args.repair) args.checksum = true;
+    if (args.report === undefined)
+        args.report = path.join(args.outputPath, "checksum-report.json");
+    configureTransport(args);
+    configureRetry(args);
+    configureEvents(args);
+    args.assetFilter = createAssetFilter(args, i18n);
+
+    process.on("SIGINT", () => {
+        emit("interrupted");
+        if (!args.json) {
+            logUpdate(i18n.sigintText);
+            logUpdate.done();
+        }
+        process.exit(1);
+    });
+
+    const manifestList = await getManifestList(args, i18n);
+    if (args.since !== undefined) {
+        args.sinceManifest =
+            manifestList.find(
+                manifest => manifest.version.toString() === args.since
+            ) ?? (await findManifest(args.since, args));
+        if (args.sinceManifest === undefined) {
+            console.error(sprintf(i18n.versionNotFound, args.since));
+            process.exit(1);
+        }
+    }
+    const downloadList = await getDownloadList(manifestList, args, i18n);
+    const report = await downloadAssets(downloadList, args, i18n);
+    if (args.json)
+        emit("summary", {
+            requests: transportStats.requests,
+            connections: transportStats.connections,
+            retries: transportStats.retries,
+            timeouts: transportStats.timeouts
+        });
+    else {
+        if (!args.checksum) console.log(i18n.downloadComplete);
+        else console.log(i18n.checksumComplete);
+        console.log(
+            sprintf(
+                i18n.connectionSummary,
+                transportStats.requests,
+                transportStats.connections,
+                transportStats.requests - transportStats.connections,
+                transportStats.retries,
+                transportStats.timeouts
+            )
+        );
+    }
+    const { missing, truncated, corrupt, repaired } = report;
+    if (missing.length + truncated.length + corrupt.length > repaired.length)
+        process.exitCode = 1;
 };
 
-main();
+main().catch(e => {
+    emit("error", { message: e.message });
+    console.error(e.message);
+    process.exit(1);
+});
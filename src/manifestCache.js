@@ -0,0 +1,72 @@
+import path from "path";
+import fs from "fs/promises";
+import { hashBuffer } from "./hashPool.js";
+
+const getManifestPath = (manifest, args) =>
+    path.join(
+        args.cachePath,
+        args.locale,
+        manifest.version.toString(),
+        manifest.indexName
+    );
+
+const writeFileAtomic = async (filePath, data) => {
+    await fs.mkdir(path.dirname(filePath), { recursive: true });
+    await fs.writeFile(`${filePath}.tmp`, data);
+    await fs.rename(`${filePath}.tmp`, filePath);
+};
+
+// the index holds the md5 of the raw manifest and its totals, so the version
+// prompt can show sizes without decoding every manifest
+export const readManifestIndex = async (manifest, args) => {
+    try {
+        return JSON.parse(
+            await fs.readFile(`${getManifestPath(manifest, args)}.json`)
+        );
+    } catch (e) {
+        return undefined;
+    }
+};
+
+export const readManifest = async (manifest, args) => {
+    const index = await readManifestIndex(manifest, args);
+    if (index === undefined) return undefined;
+    try {
+        const { digest, buf } = await hashBuffer(
+            await fs.readFile(getManifestPath(manifest, args))
+        );
+        if (digest === index.md5) return buf;
+    } catch (e) {}
+    return undefined;
+};
+
+export const writeManifest = async (manifest, buf, md5, assets, args) => {
+    const manifestPath = getManifestPath(manifest, args);
+    await writeFileAtomic(manifestPath, buf);
+    await writeFileAtomic(
+        `${manifestPath}.json`,
+        JSON.stringify({
+            md5,
+            files: assets.length,
+            size: assets.totalSize()
+        })
+    );
+};
+
+export const readVersionList = async args => {
+    try {
+        return JSON.parse(
+            await fs.readFile(
+                path.join(args.cachePath, args.locale, "versions.json")
+            )
+        );
+    } catch (e) {
+        return undefined;
+    }
+};
+
+export const writeVersionList = async (versionList, args) =>
+    writeFileAtomic(
+        path.join(args.cachePath, args.locale, "versions.json"),
+        JSON.stringify(versionList)
+    );
@@ -0,0 +1,177 @@
+import chalk from "chalk";
+import { sprintf } from "sprintf-js";
+import { MultiBar, Presets } from "cli-progress";
+import { activeConnections } from "./transport.js";
+import { formatBytes } from "./utils.js";
+
+const tickInterval = 250;
+const speedWindow = 5000;
+
+const formatDuration = seconds => {
+    if (!Number.isFinite(seconds)) return "--:--";
+    seconds = Math.round(seconds);
+    const h = Math.floor(seconds / 3600);
+    const m = Math.floor(seconds / 60) % 60;
+    const s = `${seconds % 60}`.padStart(2, "0");
+    return h > 0 ? `${h}:${`${m}`.padStart(2, "0")}:${s}` : `${m}:${s}`;
+};
+
+// progress of all selected versions in bytes of their manifest sizes. Bytes
+// are only counted here and pushed to the bars every tick, so fast links
+// don't redraw for every chunk; the speed is the average over the last few
+// seconds of bytes received, or checked when measureAll is set. Versions
+// only have a bar while they have assets left, the total bar covers all.
+class DownloadProgress {
+    constructor(manifestCount, measureAll, i18n) {
+        this.i18n = i18n;
+        this.measureAll = measureAll;
+        this.multiBar = new MultiBar(
+            {
+                clearOnComplete: true,
+                fps: 1000 / tickInterval,
+                format: `${chalk.blue("{bar}")} {version} {file} | {progress}`
+            },
+            Presets.shades_classic
+        );
+        this.size = 0;
+        this.transferred = 0;
+        this.received = 0;
+        this.samples = [];
+        this.versions = {};
+        this.counted = new Map();
+        this.totalBar = this.multiBar.create(0, 0, {
+            version: i18n.total,
+            file: "",
+            progress: ""
+        });
+        this.manifestCount = manifestCount;
+        this.manifestsDone = 0;
+        this.manifestBar = this.multiBar.create(manifestCount, 0, {
+            version: i18n.manifest,
+            file: "",
+            progress: `0/${manifestCount}`
+        });
+        this.timer = setInterval(() => this.render(), tickInterval);
+        this.render();
+    }
+
+    manifestDone(manifest) {
+        this.manifestsDone++;
+        this.manifestBar.increment(1, {
+            file:
+                this.manifestsDone === this.manifestCount
+                    ? this.i18n.done
+                    : manifest.indexName,
+            progress: `${this.manifestsDone}/${this.manifestCount}`
+        });
+    }
+
+    addVersion(assetVersion, assets) {
+        const size = assets.totalSize();
+        this.size += size;
+        if (assets.length === 0) return;
+        this.versions[assetVersion] = {
+            bar: this.multiBar.create(size, 0, {
+                version: assetVersion,
+                file: "",
+                progress: ""
+            }),
+            count: assets.length,
+            done: 0,
+            size,
+            transferred: 0,
+            file: ""
+        };
+    }
+
+    // returns the onData callback for one download of asset
+    track(assetVersion, asset) {
+        const version = this.versions[assetVersion];
+        return bytes => {
+            const counted = this.counted.get(asset) ?? 0;
+            // retries and hedges may receive more than the file holds
+            const add = Math.max(0, Math.min(bytes, asset.size - counted));
+            this.counted.set(asset, counted + add);
+            version.transferred += add;
+            version.file = asset.name;
+            this.transferred += add;
+            this.received += bytes;
+        };
+    }
+
+    done(assetVersion, asset) {
+        const version = this.versions[assetVersion];
+        const rest = asset.size - (this.counted.get(asset) ?? 0);
+        this.counted.delete(asset);
+        version.transferred += rest;
+        this.transferred += rest;
+        if (this.measureAll) this.received += rest;
+        version.file = asset.name;
+        this.finish(assetVersion, version);
+    }
+
+    // a failed asset leaves the totals, so they still add up to the end
+    failed(assetVersion, asset) {
+        const version = this.versions[assetVersion];
+        const counted = this.counted.get(asset) ?? 0;
+        this.counted.delete(asset);
+        version.transferred -= counted;
+        version.size -= asset.size;
+        this.transferred -= counted;
+        this.size -= asset.size;
+        this.finish(assetVersion, version);
+    }
+
+    finish(assetVersion, version) {
+        version.done++;
+        if (version.done < version.count) return;
+        this.multiBar.remove(version.bar);
+        delete this.versions[assetVersion];
+    }
+
+    speed() {
+        const now = Date.now();
+        this.samples.push({ time: now, received: this.received });
+        while (now - this.samples[0].time > speedWindow) this.samples.shift();
+        const first = this.samples[0];
+        const elapsed = (now - first.time) / 1000;
+        return elapsed > 0 ? (this.received - first.received) / elapsed : 0;
+    }
+
+    render() {
+        for (const version of Object.values(this.versions)) {
+            version.bar.setTotal(version.size);
+            version.bar.update(version.transferred, {
+                file: version.file,
+                progress: sprintf(
+                    this.i18n.versionProgress,
+                    version.done,
+                    version.count,
+                    formatBytes(version.transferred),
+                    formatBytes(version.size)
+                )
+            });
+        }
+        const speed = Math.round(this.speed());
+        const remaining = this.size - this.transferred;
+        this.totalBar.setTotal(this.size);
+        this.totalBar.update(this.transferred, {
+            progress: sprintf(
+                this.i18n.totalProgress,
+                formatBytes(this.transferred),
+                formatBytes(this.size),
+                formatBytes(speed),
+                formatDuration(remaining > 0 ? remaining / speed : 0),
+                activeConnections()
+            )
+        });
+    }
+
+    stop() {
+        clearInterval(this.timer);
+        this.render();
+        this.multiBar.stop();
+    }
+}
+
+export default DownloadProgress;
@@ -0,0 +1,171 @@
+import http from "http";
+import https from "https";
+import { pipeline, Transform } from "stream";
+import fetch, { Response } from "node-fetch";
+import http2Fetch, { activeSessions } from "./http2Fetch.js";
+
+export const transportStats = {
+    requests: 0,
+    connections: 0,
+    responses: 0,
+    failures: 0,
+    retries: 0,
+    timeouts: 0,
+    // total milliseconds from sending requests to receiving their headers
+    latency: 0
+};
+
+const countConnections = Agent =>
+    class extends Agent {
+        createConnection(...args) {
+            transportStats.connections++;
+            return super.createConnection(...args);
+        }
+    };
+
+const HttpAgent = countConnections(http.Agent);
+const HttpsAgent = countConnections(https.Agent);
+let agents = {};
+let maxStreams = 0;
+let connectTimeout = 0;
+let readTimeout = 0;
+const http1Origins = new Set();
+
+export const configureTransport = args => {
+    const options = {
+        keepAlive: args.keepAlive,
+        maxSockets: parseInt(args.maxSockets ?? args.batchSize, 10),
+        scheduling: "lifo"
+    };
+    agents = {
+        "http:": new HttpAgent(options),
+        "https:": new HttpsAgent(options)
+    };
+    maxStreams = args.http2 ? parseInt(args.batchSize, 10) : 0;
+    connectTimeout = parseFloat(args.connectTimeout) * 1000;
+    readTimeout = parseFloat(args.readTimeout) * 1000;
+};
+
+// node-fetch pipes the response into a stream that never ends when the
+// connection drops before the whole body arrived, so the response is watched
+// on its way through the agent and onClose called when it closes incomplete
+const watchAgent = onClose => url => {
+    const agent = agents[url.protocol];
+    return Object.assign(Object.create(agent), {
+        addRequest(req, options) {
+            req.once("response", message =>
+                message.once("close", () => {
+                    if (!message.complete) onClose();
+                })
+            );
+            return agent.addRequest(req, options);
+        }
+    });
+};
+
+// sockets with a request on them plus http/2 sessions with open streams
+export const activeConnections = () =>
+    Object.values(agents).reduce(
+        (count, agent) =>
+            Object.values(agent.sockets).reduce(
+                (count, sockets) => count + sockets.length,
+                count
+            ),
+        activeSessions()
+    );
+
+// an http/2 stream is the body itself and fails on its own when it breaks
+const request = async (url, options, onClose) => {
+    const { origin } = new URL(url);
+    if (maxStreams > 0 && !http1Origins.has(origin))
+        try {
+            return await http2Fetch(url, options, maxStreams, () =>
+                transportStats.connections++
+            );
+        } catch (e) {
+            // a timeout or cancel says nothing about http/2 support
+            if (e.connected || options.signal?.aborted) throw e;
+            // the host does not speak http/2, stay on http/1.1 from now on
+            http1Origins.add(origin);
+        }
+    return await fetch(url, { ...options, agent: watchAgent(onClose) });
+};
+
+// the body is piped through a stream that aborts the request when no bytes
+// arrive for readTimeout and fails when it ends short of content-length or
+// its connection closes first
+const watchBody = (res, method, abort, closed) => {
+    let timer;
+    const arm = () => {
+        clearTimeout(timer);
+        timer = setTimeout(() => {
+            body.destroy(new Error(`read timeout ${res.url}`));
+            abort();
+        }, readTimeout);
+    };
+    const expected = parseInt(res.headers.get("content-length"), 10);
+    let received = 0;
+    const body = pipeline(
+        res.body,
+        new Transform({
+            transform(chunk, encoding, callback) {
+                received += chunk.length;
+                arm();
+                callback(null, chunk);
+            },
+            flush(callback) {
+                if (method !== "HEAD" && expected >= 0 && received < expected)
+                    callback(new Error(`truncated body ${res.url}`));
+                else callback();
+            }
+        }),
+        () => clearTimeout(timer)
+    );
+    arm();
+    closed.then(() => body.destroy(new Error(`truncated body ${res.url}`)));
+    return new Response(body, {
+        url: res.url,
+        status: res.status,
+        statusText: res.statusText,
+        headers: res.headers
+    });
+};
+
+// every attempt gets connectTimeout to receive the response headers and
+// readTimeout between two chunks of the body
+export const transportFetch = async (url, options) => {
+    transportStats.requests++;
+    const start = Date.now();
+    const controller = new AbortController();
+    let timedOut = false;
+    const abort = () => {
+        timedOut = true;
+        transportStats.timeouts++;
+        controller.abort();
+    };
+    const timer = setTimeout(abort, connectTimeout);
+    // the caller may cancel the attempt too, before or after its headers
+    const { signal } = options;
+    if (signal?.aborted) controller.abort();
+    else if (signal !== undefined)
+        signal.addEventListener("abort", () => controller.abort());
+    let onClose;
+    const closed = new Promise(resolve => (onClose = resolve));
+    try {
+        const res = await request(
+            url,
+            { ...options, signal: controller.signal },
+            onClose
+        );
+        transportStats.responses++;
+        transportStats.latency += Date.now() - start;
+        if (res.status >= 500 || res.status === 429) transportStats.failures++;
+        return watchBody(res, options.method, abort, closed);
+    } catch (e) {
+        if (!signal?.aborted) transportStats.failures++;
+        if (timedOut) throw new Error(`connect timeout ${url}`);
+        throw e;
+    } finally {
+        clearTimeout(timer);
+    }
+};
@@ -1,29 +1,314 @@
 import crypto from "crypto";
+import fs from "fs/promises";
+import { createWriteStream } from "fs";
+import { Transform } from "stream";
+import { pipeline } from "stream/promises";
 import Promise from "bluebird";
-import fetch from "node-fetch";
+import { hashFile } from "./hashPool.js";
+import { transportFetch, transportStats } from "./transport.js";
 
-export const fetchWithRetry = async (url, method, retry) => {
-    if (method === undefined) method = "GET";
-    if (retry === undefined) retry = 3;
-    try {
-        return await fetch(url, { method });
-    } catch (e) {
-        if (retry > 0) {
-            await new Promise(resolve => setTimeout(() => resolve(), 500));
-            return await fetchWithRetry(url, method, retry - 1);
+let retryLimit = 5;
+
+export const configureRetry = args => {
+    retryLimit = parseInt(args.retries, 10);
+};
+
+const sleep = ms => new Promise(resolve => setTimeout(resolve, ms));
+
+// Retry-After is either a number of seconds or an http date
+const parseRetryAfter = value => {
+    if (value === null) return undefined;
+    const delay = /^\d+$/.test(value)
+        ? parseInt(value, 10) * 1000
+        : Date.parse(value) - Date.now();
+    return Number.isNaN(delay) ? undefined : Math.max(0, delay);
+};
+
+// runs task until it resolves, waiting a capped exponential backoff with full
+// jitter between attempts, or the delay the server asked for up to the same
+// cap; errors marked retry = false and cancellation through signal are thrown
+// at once
+export const withRetry = async (task, retries, signal) => {
+    if (retries === undefined) retries = retryLimit;
+    for (let attempt = 0; ; attempt++) {
+        try {
+            return await task();
+        } catch (e) {
+            if (e.retry === false || attempt >= retries || signal?.aborted)
+                throw e;
+            transportStats.retries++;
+            await sleep(
+                Math.min(
+                    30000,
+                    e.retryAfter ?? Math.random() * 500 * 2 ** attempt
+                )
+            );
         }
-        console.error(e.message);
     }
 };
 
+// a single request; statuses other than 2xx are thrown, and only 5xx and 429
+// are worth another attempt
+export const fetchOnce = async (url, method, headers, signal) => {
+    if (method === undefined) method = "GET";
+    const res = await transportFetch(url, { method, headers, signal });
+    if (res.ok) return res;
+    res.body.resume();
+    const e = new Error(`HTTP ${res.status} ${url}`);
+    e.status = res.status;
+    if (res.status >= 500 || res.status === 429)
+        e.retryAfter = parseRetryAfter(res.headers.get("retry-after"));
+    else e.retry = false;
+    throw e;
+};
+
+export const fetchWithRetry = (url, method, headers, retries) =>
+    withRetry(() => fetchOnce(url, method, headers), retries);
+
 export const getResponseAssetHash = res =>
     Buffer.from(
         res.headers.get("x-goog-hash").replace(/^.*md5=/, ""),
         "base64"
     ).toString("hex");
 
-export const getBufferChecksum = buf =>
-    crypto.createHash("md5").update(buf).digest("hex");
+const hashStream = (hash, onData) =>
+    new Transform({
+        transform(chunk, encoding, callback) {
+            if (hash !== undefined) hash.update(chunk);
+            if (onData !== undefined) onData(chunk.length);
+            callback(null, chunk);
+        }
+    });
+
+// downloads url into filePath through filePath.part, which is kept when the
+// transfer breaks so retries and later runs continue with a range request;
+// the part is renamed into place only if the md5 of the whole file matches,
+// and a resumed part that doesn't is fetched once more from the start;
+// options may set another partPath, a signal to cancel the download, which
+// also removes the part, and onData to receive the size of every chunk
+export const downloadFile = async (url, filePath, options) => {
+    if (options === undefined) options = {};
+    const { signal, onData } = options;
+    if (filePath === undefined)
+        return await withRetry(
+            async () => {
+                const res = await fetchOnce(url, "GET", {}, signal);
+                const hash = crypto.createHash("md5");
+                for await (const chunk of res.body) {
+                    hash.update(chunk);
+                    if (onData !== undefined) onData(chunk.length);
+                }
+                return getResponseAssetHash(res) === hash.digest("hex");
+            },
+            undefined,
+            signal
+        );
+
+    const partPath = options.partPath ?? `${filePath}.part`;
+    const attempt = async () => {
+        let offset = 0;
+        try {
+            offset = (await fs.stat(partPath)).size;
+        } catch (e) {}
+        let res;
+        try {
+            res = await fetchOnce(
+                url,
+                "GET",
+                offset > 0 ? { Range: `bytes=${offset}-` } : {},
+                signal
+            );
+        } catch (e) {
+            if (e.status === 416) {
+                // the part is not a prefix of this file any more, start over
+                // right away although other 4xx are final
+                await fs.unlink(partPath);
+                e.retry = true;
+                e.retryAfter = 0;
+            }
+            throw e;
+        }
+
+        // a fresh body is hashed as it streams; a resumed part is hashed as
+        // a whole on the pool afterwards, so the response is read at once
+        // and the prefix is never hashed on the main thread
+        const resumed = offset > 0 && res.status === 206;
+        const hash = resumed ? undefined : crypto.createHash("md5");
+        await pipeline(
+            res.body,
+            hashStream(hash, onData),
+            createWriteStream(partPath, { flags: resumed ? "a" : "w" })
+        );
+        const digest = resumed ? await hashFile(partPath) : hash.digest("hex");
+        return { res, digest, resumed };
+    };
+    for (let fresh = false; ; fresh = true) {
+        let res, digest, resumed;
+        try {
+            ({ res, digest, resumed } = await withRetry(
+                attempt,
+                undefined,
+                signal
+            ));
+        } catch (e) {
+            if (signal?.aborted) await fs.unlink(partPath).catch(() => {});
+            throw e;
+        }
+        if (getResponseAssetHash(res) === digest) break;
+        await fs.unlink(partPath);
+        // the kept prefix may be what is wrong
+        if (!resumed || fresh) return false;
+    }
+    await fs.rename(partPath, filePath);
+    return true;
+};
+
+// true when res holds exactly bytes from-to; a proxy that answers a range
+// with 200 and the whole file would otherwise overwrite other segments
+const isRange = (res, from, to) =>
+    res.status === 206 &&
+    (res.headers.get("content-range") ?? "").startsWith(`bytes ${from}-${to}/`);
+
+// downloads a file of known size as parallel byte ranges written in place
+// into a preallocated filePath.seg, then checks the md5 of the whole file;
+// falls back to downloadFile as soon as any range is not honoured. The
+// offset of every range is saved next to it in filePath.seg.json, so a run
+// that was interrupted continues each range where it stopped, while a
+// download that fails removes both files.
+export const downloadFileSegmented = async (
+    url,
+    filePath,
+    size,
+    segments,
+    onData
+) => {
+    const segmentSize = Math.ceil(size / segments);
+    const starts = Array.from({ length: segments }, (_, i) => i * segmentSize);
+    const segPath = `${filePath}.seg`;
+    const progressPath = `${segPath}.json`;
+    let resumed;
+    try {
+        resumed = JSON.parse(await fs.readFile(progressPath, "utf8"));
+        if (
+            resumed.size !== size ||
+            resumed.positions.length !== segments ||
+            (await fs.stat(segPath)).size !== size
+        )
+            resumed = undefined;
+    } catch (e) {
+        resumed = undefined;
+    }
+    const positions = resumed?.positions ?? [...starts];
+    let expected = resumed?.expected;
+    let saving = Promise.resolve();
+    const save = () =>
+        (saving = saving
+            .then(() =>
+                fs.writeFile(
+                    progressPath,
+                    JSON.stringify({ size, expected, positions })
+                )
+            )
+            .catch(() => {}));
+
+    const handle = await fs.open(segPath, resumed ? "r+" : "w");
+    const controller = new AbortController();
+    let failure;
+    let timer;
+    try {
+        if (!resumed) await handle.truncate(size);
+        // every attempt continues the range where the previous one broke off
+        const fetchSegment = async (i, res) => {
+            const end = Math.min(size, starts[i] + segmentSize) - 1;
+            await withRetry(
+                async () => {
+                    if (positions[i] > end) return;
+                    if (res === undefined)
+                        res = await fetchOnce(
+                            url,
+                            "GET",
+                            { Range: `bytes=${positions[i]}-${end}` },
+                            controller.signal
+                        );
+                    const body = res.body;
+                    if (!isRange(res, positions[i], end)) {
+                        body.destroy();
+                        throw Object.assign(
+                            new Error(`no range support for ${url}`),
+                            { retry: false, noRange: true }
+                        );
+                    }
+                    res = undefined;
+                    for await (const chunk of body) {
+                        await handle.write(
+                            chunk,
+                            0,
+                            chunk.length,
+                            positions[i]
+                        );
+                        positions[i] += chunk.length;
+                        if (onData !== undefined) onData(chunk.length);
+                    }
+                    if (positions[i] <= end)
+                        throw new Error(
+                            `incomplete range ${starts[i]}-${end} of ${url}`
+                        );
+                },
+                undefined,
+                controller.signal
+            );
+        };
+
+        let first;
+        if (expected === undefined) {
+            first = await fetchWithRetry(url, "GET", {
+                Range: `bytes=0-${segmentSize - 1}`
+            });
+            expected = getResponseAssetHash(first);
+        }
+        await save();
+        timer = setInterval(save, 1000);
+        // the first failure stops the other segments, which are waited for
+        // so nothing writes to the file once it is closed
+        await Promise.all(
+            starts.map((_, i) =>
+                fetchSegment(i, i === 0 ? first : undefined).catch(e => {
+                    if (failure === undefined) failure = e;
+                    controller.abort();
+                })
+            )
+        );
+    } catch (e) {
+        failure = e;
+    } finally {
+        clearInterval(timer);
+        await saving;
+        await handle.close().catch(() => {});
+    }
+
+    const remove = () =>
+        Promise.all([
+            fs.unlink(segPath).catch(() => {}),
+            fs.unlink(progressPath).catch(() => {})
+        ]);
+    if (failure !== undefined) {
+        await remove();
+        if (failure.noRange)
+            return await downloadFile(url, filePath, { onData });
+        throw failure;
+    }
+    if ((await hashFile(segPath)) !== expected) {
+        await remove();
+        return false;
+    }
+    await fs.unlink(progressPath).catch(() => {});
+    await fs.rename(segPath, filePath);
+    return true;
+};
+
+// manifest hashes are hex digests, their length tells the algorithm
+export const getHashAlgorithm = hash =>
+    ({ 32: "md5", 40: "sha1", 64: "sha256" }[hash.length]);
 
 export const formatBytes = bytes => {
     if (bytes === 0) return "0 Bytes";
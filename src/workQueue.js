@@ -0,0 +1,55 @@
+// runs pushed tasks with at most getConcurrency() of them in flight; the
+// limit is read again whenever a slot frees up, so it may change at runtime
+class WorkQueue {
+    constructor(getConcurrency) {
+        this.getConcurrency = getConcurrency;
+        this.pending = [];
+        this.active = 0;
+        this.waiting = [];
+        this.draining = [];
+    }
+
+    limit() {
+        return Math.max(1, this.getConcurrency());
+    }
+
+    // resolves once fewer than a round of tasks is pending, so producers
+    // can hold back instead of queueing all their work up front
+    ready() {
+        if (this.pending.length < this.limit()) return Promise.resolve();
+        return new Promise(resolve => this.waiting.push(resolve));
+    }
+
+    // resolves once every pushed task has finished
+    drained() {
+        if (this.active === 0 && this.pending.length === 0)
+            return Promise.resolve();
+        return new Promise(resolve => this.draining.push(resolve));
+    }
+
+    push(task) {
+        return new Promise((resolve, reject) => {
+            this.pending.push({ task, resolve, reject });
+            this.next();
+        });
+    }
+
+    next() {
+        while (this.pending.length > 0 && this.active < this.limit()) {
+            const { task, resolve, reject } = this.pending.shift();
+            this.active++;
+            task()
+                .then(resolve, reject)
+                .finally(() => {
+                    this.active--;
+                    this.next();
+                });
+        }
+        while (this.waiting.length > 0 && this.pending.length < this.limit())
+            this.waiting.shift()();
+        if (this.active === 0 && this.pending.length === 0)
+            for (const resolve of this.draining.splice(0)) resolve();
+    }
+}
+
+export default WorkQueue;